@@ -0,0 +1,150 @@
+// mlvm
+// Copyright (c) 2025 Madrona Labs LLC. http://www.madronalabs.com
+
+// offline benchmark of the VM at each compiled vector width.
+
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include "madronalib.h"
+#include "mlvm.h"
+#include "assembler.h"
+
+using namespace mlvm;
+
+constexpr int kSampleRate = 48000;
+constexpr int kSecondsToRender = 20;
+constexpr size_t kChannels = 2;
+
+// like an offline renderer, process a block of frames at a time, reusing the same buffers.
+// Rendering into one long buffer would mostly measure the memory bandwidth.
+constexpr size_t kBlockFrames = 4096;
+constexpr float kTwoPi = 6.2831853f;
+
+// a program with a typical mix of register and memory operations.
+const char* kBenchmarkCode = R"(
+  MOV R2, #5
+  LDR R3, =0.25
+  MUL R4, R0, R3
+  ADD R4, R4, R2
+  STR R4, [#3]
+  MUL R5, R4, R4
+  ADD R5, R5, R1
+  LDR R6, [#3]
+  MUL R6, R6, R5
+  ADD R0, R6, R4
+  MUL R1, R5, R3
+  END
+)";
+
+// the same operations using registers above 127, so every instruction needs a WIDE prefix.
+const char* kWideBenchmarkCode = R"(
+  MOV R202, #5
+  LDR R203, =0.25
+  MUL R204, R0, R203
+  ADD R204, R204, R202
+  STR R204, [#3]
+  MUL R205, R204, R204
+  ADD R205, R205, R1
+  LDR R206, [#3]
+  MUL R206, R206, R205
+  ADD R0, R206, R204
+  MUL R1, R205, R203
+  END
+)";
+
+// fill the inputs with a fixed, bounded test signal and clear the outputs, so that every
+// run processes the same data.
+void resetBuffers(std::vector< std::vector< float > >& inputs, std::vector< std::vector< float > >& outputs)
+{
+  for(size_t c = 0; c < inputs.size(); ++c)
+  {
+    const float freq = 220.f*(c + 1);
+    for(size_t i = 0; i < inputs[c].size(); ++i)
+    {
+      inputs[c][i] = 0.5f*std::sin(kTwoPi*freq*i/kSampleRate);
+    }
+  }
+  for(auto& b : outputs) std::fill(b.begin(), b.end(), 0.f);
+}
+
+// render the given number of blocks, returning the time taken in nanoseconds.
+double renderBuffers(VMInterface& vm, const std::vector< std::vector< float > >& inputs,
+                     std::vector< std::vector< float > >& outputs, size_t numBlocks)
+{
+  const float* inputPtrs[kChannels];
+  float* outputPtrs[kChannels];
+  for(size_t c = 0; c < kChannels; ++c)
+  {
+    inputPtrs[c] = inputs[c].data();
+    outputPtrs[c] = outputs[c].data();
+  }
+  
+  auto startTime = std::chrono::steady_clock::now();
+  for(size_t block = 0; block < numBlocks; ++block)
+  {
+    vm.processBuffers(inputPtrs, kChannels, outputPtrs, kChannels, kBlockFrames);
+  }
+  auto endTime = std::chrono::steady_clock::now();
+  return std::chrono::duration< double, std::nano >(endTime - startTime).count();
+}
+
+int main( int argc, char *argv[] )
+{
+  ToyAssembler assembler;
+  Program program = assembler.assemble(kBenchmarkCode);
+  
+  const size_t numBlocks = kSampleRate * kSecondsToRender / kBlockFrames;
+  const size_t totalFrames = numBlocks * kBlockFrames;
+  std::vector< std::vector< float > > inputs(kChannels, std::vector< float >(kBlockFrames));
+  std::vector< std::vector< float > > outputs(kChannels, std::vector< float >(kBlockFrames));
+  
+  std::cout << "rendering " << kSecondsToRender << " seconds at " << kSampleRate << " Hz\n\n";
+  std::cout << " width  latency(ms)  ns/vector  ns/sample  x realtime\n";
+
+  for(size_t width : kVectorWidths)
+  {
+    auto vm = createMLVM(width);
+    vm->allocateMemory(MemoryRequirements{ 128, 128 });
+    vm->setProgram(program);
+    
+    resetBuffers(inputs, outputs);
+    double ns = renderBuffers(*vm, inputs, outputs, numBlocks);
+    double nsPerSample = ns / totalFrames;
+    double nsPerVector = nsPerSample * width;
+    
+    // the latency of a live rig is one vector of buffering plus the time to compute it.
+    double latencyMs = 1000.0 * width / kSampleRate + nsPerVector * 1e-6;
+    double realtimeFactor = (1e9 * totalFrames / kSampleRate) / ns;
+    
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << std::setw(6) << width << std::setw(13) << latencyMs;
+    std::cout << std::setw(11) << std::setprecision(1) << nsPerVector;
+    std::cout << std::setw(11) << std::setprecision(3) << nsPerSample;
+    std::cout << std::setw(12) << std::setprecision(1) << realtimeFactor << "\n";
+  }
+  
+  // compare the cost of narrow and wide instructions at the default width. The narrow
+  // figure is the one to watch for regressions in the main interpreter loop.
+  Program wideProgram = assembler.assemble(kWideBenchmarkCode);
+  const size_t numOps = program.instructions.size();
+  const size_t numVectors = totalFrames / kFloatsPerDSPVector;
+  
+  std::cout << "\ninstruction cost at width " << kFloatsPerDSPVector << ":\n";
+  std::cout << "        instructions  ns/operation\n";
+  for(const Program* p : {&program, &wideProgram})
+  {
+    auto vm = createMLVM(kFloatsPerDSPVector);
+    vm->allocateMemory(MemoryRequirements{ 128, 128, p->memReqs.registerVectors });
+    vm->setProgram(*p);
+    
+    resetBuffers(inputs, outputs);
+    double ns = renderBuffers(*vm, inputs, outputs, numBlocks);
+    std::cout << std::setw(6) << (p == &program ? "narrow" : "wide");
+    std::cout << std::setw(14) << p->instructions.size();
+    std::cout << std::setw(16) << std::setprecision(2) << ns / (numVectors * numOps) << "\n";
+  }
+  
+  return 0;
+}
@@ -18,7 +18,7 @@ constexpr int kSampleRate = 48000;
 constexpr float kOutputGain = 0.1f;
 
 struct VMExampleState {
-  MLVM* vm{nullptr};
+  MLVM<>* vm{nullptr};
   EventsToSignals* eventsToSignals{nullptr};
 };
 
@@ -31,7 +31,7 @@ void processAudio(AudioContext* ctx, void *state)
   // to this but would have added a lot of template code behind the scenes.
   auto procState = static_cast<VMExampleState*>(state);
   
-  MLVM* vm = procState->vm;
+  MLVM<>* vm = procState->vm;
   EventsToSignals* evToSigs = procState->eventsToSignals;
 
   int startOffset(0);
@@ -68,7 +68,7 @@ int main( int argc, char *argv[] )
   t->start(deferToMainThread);
 
   // setup the vm
-  MLVM vm;
+  MLVM<> vm;
 
   // TODO compile the graph of modules, getting memory needs
   // auto testGraph = readJSONGraph;
@@ -93,7 +93,10 @@ int main( int argc, char *argv[] )
 
   // TEMP allocate program memory and set opcodes explicitly
   vm.allocateMemory(MemoryRequirements{ 128, 128 });
-  vm.setProgram(testProgram);
+  if (!vm.setProgram(testProgram)) {
+    std::cout << "couldn't set program!\n";
+    return 0;
+  }
 
   // fill a struct with the data the callback will need to create a context.
   VMExampleState state{&vm, &eventsToSignals};
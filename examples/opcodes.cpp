@@ -0,0 +1,498 @@
+// mlvm
+// Copyright (c) 2025 Madrona Labs LLC. http://www.madronalabs.com
+
+// runs programs using the delay line and table opcodes at each compiled vector width,
+// comparing the outputs to known values. Also compares wide instructions to narrow ones, checks
+// the latency of process() and checks the counts made by the profiler.
+// Returns nonzero if any output is wrong.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include "madronalib.h"
+#include "mlvm.h"
+#include "assembler.h"
+#include "tables.h"
+
+using namespace mlvm;
+
+constexpr size_t kTestFrames = 4096;
+constexpr float kTolerance = 1e-3f;
+
+// a delay line long enough for 300 samples is 1024 samples long. A delay of 100 samples
+// is not a multiple of any vector width, so some reads wrap around the end of the buffer.
+const char* kDelayCode = R"(
+  .DELAY D0, 300
+  LDR R3, =100.
+  LDR R4, =100.5
+  DWRITE D0, R0
+  DREAD R2, D0, R3
+  DTAP R3, D0, R4
+  DTAP R4, D0, R1
+  END
+)";
+
+// a feedback comb filter reads the line before writing it: y[n] = x[n] + 0.5*y[n - 300].
+// The delay is at least the largest vector width, so the output is the same at every width.
+// Before the write, a read can also delay by the whole length of the line, 1024 samples.
+const char* kCombCode = R"(
+  .DELAY D0, 300
+  LDR R3, =300.
+  LDR R4, =0.5
+  LDR R6, =1024.
+  DREAD R5, D0, R6
+  DREAD R2, D0, R3
+  MUL R2, R2, R4
+  ADD R2, R2, R0
+  DWRITE D0, R2
+  END
+)";
+
+// a bounded input for the comb filter.
+float combInput(long i) { return float(i % 100)/100.f; }
+
+// the ramp written to the delay line, and zero before it starts.
+float ramp(long i) { return i < 0 ? 0.f : float(i + 1); }
+
+// the modulated delay time for each sample.
+float modulatedDelay(long i) { return 40.f + 0.25f*(i % 8); }
+
+// T0 is a ramp table registered from memory, and T1 is the same ramp mapped from a file.
+// Phases outside [0, 1) wrap, and TSHAPE inputs outside [-1, 1] clamp to the ends.
+const char* kTableCode = R"(
+  .TABLE T0, ramp
+  .TABLE T1, rampFile
+  TLOOKUP R2, T0, R0
+  TLOOKUP R3, T1, R0
+  TSHAPE R4, T0, R1
+  END
+)";
+
+constexpr size_t kTableSize = 8;
+const char* kTableFile = "opcodes_ramp.raw";
+
+float tableValue(size_t i) { return float(i)/kTableSize; }
+
+// the lookup phase runs from -3 to about 38, and the shaper input from -2 to about 2.
+float lookupPhase(long i) { return i*0.01f - 3.f; }
+float shapeInput(long i) { return i*0.001f - 2.f; }
+
+// interpolating the ramp gives back the phase, except between the last entry and the first.
+float expectedLookup(long i)
+{
+  float p = lookupPhase(i);
+  float x = (p - std::floor(p))*kTableSize;
+  float last = float(kTableSize - 1);
+  return x < last ? x/kTableSize : tableValue(kTableSize - 1)*(kTableSize - x);
+}
+
+// the shaper maps [-1, 1] onto the whole table.
+float expectedShape(long i)
+{
+  float x = (std::clamp(shapeInput(i), -1.f, 1.f) + 1.f)*0.5f*(kTableSize - 1);
+  return x/kTableSize;
+}
+
+// each run loads arena vector 3 and stores to vectors 3 and 5.
+const char* kArenaCode = R"(
+  LDR R2, [#3]
+  ADD R2, R2, R0
+  STR R2, [#3]
+  STR R2, [#5]
+  END
+)";
+
+// a program using narrow instructions, and the same operations using a register above 255,
+// an arena offset above 2^14 and a literal index above 2^14, which all need WIDE prefixes.
+const char* kNarrowCode = R"(
+  LDR R2, =0.25
+  MUL R3, R0, R2
+  STR R3, [#5]
+  LDR R4, [#5]
+  ADD R4, R4, R1
+  END
+)";
+
+const char* kWideCode = R"(
+  LDR R300, =0.25
+  MUL R301, R0, R300
+  STR R301, [#20000]
+  LDR R302, [#20000]
+  ADD R302, R302, R1
+  MOV R2, R300
+  MOV R3, R301
+  MOV R4, R302
+  END
+)";
+
+constexpr size_t kNumPaddingLiterals = 16400;
+
+// adds one to the input.
+const char* kAddOneCode = R"(
+  LDR R1, =1.
+  ADD R0, R0, R1
+  END
+)";
+
+int numFailures{0};
+
+// compare each sample of the output to the expected value, reporting the first difference.
+void check(const char* name, size_t width, const std::vector< float >& output, std::function< float(long) > expected)
+{
+  for(size_t i = 0; i < output.size(); ++i)
+  {
+    if(std::fabs(output[i] - expected(i)) > kTolerance)
+    {
+      std::cout << "FAILED " << name << " at width " << width << ", sample " << i << ": ";
+      std::cout << output[i] << " != " << expected(i) << "\n";
+      numFailures++;
+      return;
+    }
+  }
+}
+
+// compare a count to its expected value.
+void checkCount(const char* name, size_t width, uint64_t count, uint64_t expected)
+{
+  if(count != expected)
+  {
+    std::cout << "FAILED " << name << " at width " << width << ": ";
+    std::cout << count << " != " << expected << "\n";
+    numFailures++;
+  }
+}
+
+// run a program at the given width over the inputs, returning all of its registers
+// as outputs.
+std::vector< std::vector< float > > runProgram(const Program& program, size_t width,
+                                               const std::vector< std::vector< float > >& inputs,
+                                               size_t numOutputs, bool printProfile = false)
+{
+  std::vector< std::vector< float > > outputs(numOutputs, std::vector< float >(kTestFrames, 0.f));
+  std::vector< const float* > inputPtrs;
+  std::vector< float* > outputPtrs;
+  for(auto& b : inputs) inputPtrs.push_back(b.data());
+  for(auto& b : outputs) outputPtrs.push_back(b.data());
+  
+  auto vm = createMLVM(width);
+  vm->allocateMemory(program.memReqs);
+  if(!vm->setProgram(program))
+  {
+    std::cout << "FAILED setProgram at width " << width << "\n";
+    numFailures++;
+    return outputs;
+  }
+  
+  if(printProfile)
+  {
+    vm->setProfileMode(PROFILE_INSTRUMENTED);
+  }
+  vm->processBuffers(inputPtrs.data(), inputPtrs.size(), outputPtrs.data(), outputPtrs.size(), kTestFrames);
+  if(printProfile)
+  {
+    ToyAssembler assembler;
+    assembler.printProfile(program, vm->getProfile());
+  }
+  return outputs;
+}
+
+void testDelays()
+{
+  ToyAssembler assembler;
+  Program program = assembler.assemble(kDelayCode);
+  
+  std::vector< std::vector< float > > inputs(2, std::vector< float >(kTestFrames));
+  for(size_t i = 0; i < kTestFrames; ++i)
+  {
+    inputs[0][i] = ramp(i);
+    inputs[1][i] = modulatedDelay(i);
+  }
+  
+  for(size_t width : kVectorWidths)
+  {
+    auto outputs = runProgram(program, width, inputs, 5, width == kFloatsPerDSPVector);
+    
+    check("delayed ramp", width, outputs[2], [](long i) { return ramp(i - 100); });
+    check("fractional tap", width, outputs[3], [](long i) { return 0.5f*(ramp(i - 100) + ramp(i - 101)); });
+    check("modulated tap", width, outputs[4], [](long i) {
+      float d = modulatedDelay(i);
+      long dInt = long(d);
+      float frac = d - dInt;
+      return ramp(i - dInt) + frac*(ramp(i - dInt - 1) - ramp(i - dInt));
+    });
+  }
+}
+
+void testComb()
+{
+  ToyAssembler assembler;
+  Program program = assembler.assemble(kCombCode);
+  
+  std::vector< std::vector< float > > inputs(1, std::vector< float >(kTestFrames));
+  std::vector< float > expected(kTestFrames);
+  for(size_t i = 0; i < kTestFrames; ++i)
+  {
+    inputs[0][i] = combInput(i);
+    float feedback = (i >= 300) ? expected[i - 300] : 0.f;
+    expected[i] = feedback*0.5f + inputs[0][i];
+  }
+  
+  for(size_t width : kVectorWidths)
+  {
+    auto outputs = runProgram(program, width, inputs, 6);
+    check("feedback comb", width, outputs[2], [&](long i) { return expected[i]; });
+    check("read of the whole line", width, outputs[5], [&](long i) { return i < 1024 ? 0.f : expected[i - 1024]; });
+  }
+  
+  // a new program starts with silent delay lines, even if it declares the same ones.
+  const char* kReadCode = R"(
+    .DELAY D0, 300
+    LDR R3, =64.
+    DREAD R2, D0, R3
+    END
+  )";
+  Program readProgram = assembler.assemble(kReadCode);
+  for(size_t width : kVectorWidths)
+  {
+    std::vector< float > ones(kTestFrames, 1.f);
+    std::vector< std::vector< float > > outputs(3, std::vector< float >(kTestFrames));
+    const float* inputPtrs[1]{ones.data()};
+    float* outputPtrs[3]{outputs[0].data(), outputs[1].data(), outputs[2].data()};
+    
+    auto vm = createMLVM(width);
+    vm->allocateMemory(program.memReqs);
+    vm->setProgram(program);
+    vm->processBuffers(inputPtrs, 1, outputPtrs, 3, kTestFrames);
+    vm->setProgram(readProgram);
+    vm->processBuffers(inputPtrs, 1, outputPtrs, 3, kTestFrames);
+    check("delay line after program change", width, outputs[2], [](long) { return 0.f; });
+  }
+}
+
+void testTables()
+{
+  std::vector< float > table(kTableSize);
+  for(size_t i = 0; i < kTableSize; ++i)
+  {
+    table[i] = tableValue(i);
+  }
+  {
+    std::ofstream file(kTableFile, std::ios::binary);
+    file.write(reinterpret_cast< const char* >(table.data()), table.size()*sizeof(float));
+  }
+  TableRegistry::instance().registerTable("ramp", table);
+  if(!TableRegistry::instance().mapTableFile("rampFile", kTableFile))
+  {
+    std::cout << "FAILED mapping " << kTableFile << "\n";
+    numFailures++;
+  }
+  
+  ToyAssembler assembler;
+  Program program = assembler.assemble(kTableCode);
+  
+  std::vector< std::vector< float > > inputs(2, std::vector< float >(kTestFrames));
+  for(size_t i = 0; i < kTestFrames; ++i)
+  {
+    inputs[0][i] = lookupPhase(i);
+    inputs[1][i] = shapeInput(i);
+  }
+  
+  for(size_t width : kVectorWidths)
+  {
+    auto outputs = runProgram(program, width, inputs, 5);
+    
+    check("table lookup", width, outputs[2], expectedLookup);
+    check("mapped table lookup", width, outputs[3], expectedLookup);
+    check("table shape", width, outputs[4], expectedShape);
+  }
+  
+  // a program using a table that isn't registered can't be run, and the previous program stays.
+  Program missingProgram = assembler.assemble(".TABLE T0, missing\nTLOOKUP R2, T0, R0\nEND\n");
+  for(size_t width : kVectorWidths)
+  {
+    std::vector< std::vector< float > > outputs(3, std::vector< float >(kTestFrames));
+    const float* inputPtrs[2]{inputs[0].data(), inputs[1].data()};
+    float* outputPtrs[3]{outputs[0].data(), outputs[1].data(), outputs[2].data()};
+    
+    auto vm = createMLVM(width);
+    vm->allocateMemory(program.memReqs);
+    vm->setProgram(program);
+    checkCount("missing table rejected", width, vm->setProgram(missingProgram), 0);
+    vm->processBuffers(inputPtrs, 2, outputPtrs, 3, kTestFrames);
+    check("table lookup after rejected program", width, outputs[2], expectedLookup);
+  }
+  
+  TableRegistry::instance().removeTable("ramp");
+  TableRegistry::instance().removeTable("rampFile");
+  std::remove(kTableFile);
+}
+
+// wide instructions must give the same results as narrow ones.
+void testWide()
+{
+  ToyAssembler assembler;
+  Program narrowProgram = assembler.assemble(kNarrowCode);
+  
+  // fill the literal pool so that the wide program's literal has a wide index.
+  std::string wideCode;
+  for(size_t i = 0; i < kNumPaddingLiterals; ++i)
+  {
+    wideCode += "LDR R5, =" + std::to_string(i) + ".\n";
+  }
+  wideCode += kWideCode;
+  Program wideProgram = assembler.assemble(wideCode);
+  
+  std::vector< std::vector< float > > inputs(2, std::vector< float >(kTestFrames));
+  for(size_t i = 0; i < kTestFrames; ++i)
+  {
+    inputs[0][i] = ramp(i);
+    inputs[1][i] = modulatedDelay(i);
+  }
+  
+  for(size_t width : kVectorWidths)
+  {
+    auto narrowOutputs = runProgram(narrowProgram, width, inputs, 5);
+    auto wideOutputs = runProgram(wideProgram, width, inputs, 5);
+    for(size_t i = 0; i < 5; ++i)
+    {
+      check("wide instructions", width, wideOutputs[i], [&](long j) { return narrowOutputs[i][j]; });
+    }
+    
+    // a store past the end of the arena can't be run.
+    auto vm = createMLVM(width);
+    vm->allocateMemory({128, 128});
+    checkCount("store past the arena rejected", width, vm->setProgram(wideProgram), 0);
+  }
+}
+
+// run a program through process() one DSPVector at a time, as a host would. Widths larger
+// than a DSPVector buffer their input and output, so the output is delayed by kWidth samples.
+void testProcess()
+{
+  ToyAssembler assembler;
+  Program program = assembler.assemble(kAddOneCode);
+  
+  for(size_t width : kVectorWidths)
+  {
+    auto vm = createMLVM(width);
+    vm->allocateMemory(program.memReqs);
+    vm->setProgram(program);
+    
+    AudioContext context(1, 1, 48000);
+    std::vector< float > output(kTestFrames);
+    for(size_t start = 0; start < kTestFrames; start += kFloatsPerDSPVector)
+    {
+      for(size_t i = 0; i < kFloatsPerDSPVector; ++i)
+      {
+        context.inputs[0][i] = ramp(start + i);
+      }
+      vm->process(&context);
+      for(size_t i = 0; i < kFloatsPerDSPVector; ++i)
+      {
+        output[start + i] = context.outputs[0][i];
+      }
+    }
+    
+    const long latency = (width > kFloatsPerDSPVector) ? width : 0;
+    check("process() latency", width, output, [=](long i) { return i < latency ? 0.f : ramp(i - latency) + 1.f; });
+  }
+}
+
+void testProfile()
+{
+  ToyAssembler assembler;
+  Program program = assembler.assemble(kArenaCode);
+  Program otherProgram = assembler.assemble(kDelayCode);
+  const size_t numInstructions = program.instructions.size();
+  
+  std::vector< float > input(kTestFrames, 1.f);
+  std::vector< float > output(kTestFrames);
+  const float* inputs[1]{input.data()};
+  float* outputs[1]{output.data()};
+  
+  for(size_t width : kVectorWidths)
+  {
+    const uint64_t runsPerCall = kTestFrames/width;
+    auto vm = createMLVM(width);
+    vm->allocateMemory({8, 0});
+    vm->setProgram(program);
+    
+    // every call is measured, and each instruction is counted once per run.
+    vm->setProfileMode(PROFILE_INSTRUMENTED);
+    for(int call = 0; call < 2; ++call)
+    {
+      vm->processBuffers(inputs, 1, outputs, 1, kTestFrames);
+    }
+    const Profile& profile = vm->getProfile();
+    checkCount("instrumented process calls", width, profile.processCalls, 2);
+    for(size_t pc = 0; pc < numInstructions; ++pc)
+    {
+      checkCount("instruction count", width, profile.counts[pc], 2*runsPerCall);
+    }
+    for(size_t offset = 0; offset < profile.arenaReads.size(); ++offset)
+    {
+      checkCount("arena reads", width, profile.arenaReads[offset], (offset == 3) ? 2*runsPerCall : 0);
+      checkCount("arena writes", width, profile.arenaWrites[offset], (offset == 3 || offset == 5) ? 2*runsPerCall : 0);
+    }
+    
+    // the exporters report the same counts.
+    std::ostringstream json;
+    assembler.writeProfileJSON(program, profile, json);
+    checkCount("JSON process calls", width, json.str().find("\"processCalls\": 2,") != std::string::npos, 1);
+    checkCount("JSON instruction count", width,
+               json.str().find("\"count\": " + std::to_string(2*runsPerCall) + ",") != std::string::npos, 1);
+    std::stringstream stacks;
+    assembler.writeCollapsedStacks(program, profile, stacks);
+    std::string line;
+    size_t numLines{0};
+    while(std::getline(stacks, line))
+    {
+      checkCount("collapsed stack line", width, line.compare(0, 5, "mlvm;") == 0, 1);
+      numLines++;
+    }
+    checkCount("collapsed stack lines", width, numLines <= numInstructions, 1);
+    
+    // in sampled mode, calls 0, 4 and 8 of 10 are measured, whatever the number of runs per call.
+    vm->setProfileMode(PROFILE_SAMPLED, 4);
+    for(int call = 0; call < 10; ++call)
+    {
+      vm->processBuffers(inputs, 1, outputs, 1, kTestFrames);
+    }
+    checkCount("sampled process calls", width, profile.processCalls, 3);
+    checkCount("sampled instruction count", width, profile.counts[0], 3*runsPerCall);
+    
+    // changing the program starts a new profile.
+    vm->setProgram(otherProgram);
+    checkCount("process calls after program change", width, profile.processCalls, 0);
+    for(size_t pc = 0; pc < profile.counts.size(); ++pc)
+    {
+      checkCount("count after program change", width, profile.counts[pc], 0);
+    }
+    for(size_t line = 0; line < profile.delayReads.size(); ++line)
+    {
+      checkCount("delay reads after program change", width, profile.delayReads[line], 0);
+    }
+  }
+}
+
+int main( int argc, char *argv[] )
+{
+  testDelays();
+  testComb();
+  testTables();
+  testWide();
+  testProcess();
+  testProfile();
+  
+  if(numFailures)
+  {
+    std::cout << numFailures << " checks failed.\n";
+    return 1;
+  }
+  std::cout << "all checks passed.\n";
+  return 0;
+}
@@ -14,6 +14,7 @@
 #include <unordered_map>
 #include <cctype>
 #include <algorithm>
+#include <ostream>
 
 #include "mlvm.h"
 
@@ -41,6 +42,11 @@ private:
     opMap["SHIFT"] = SHIFT;
     opMap["INTERP"] = INTERP;
     opMap["SVF"] = SVF;
+    opMap["DWRITE"] = DELAY_WRITE;
+    opMap["DREAD"] = DELAY_READ;
+    opMap["DTAP"] = DELAY_TAP;
+    opMap["TLOOKUP"] = TABLE_LOOKUP;
+    opMap["TSHAPE"] = TABLE_SHAPE;
   }
   
   std::string trim(const std::string& str) {
@@ -86,13 +92,46 @@ private:
      std::isdigit(token[0]));
   }
   
+  // resources declared by directives are named by a letter and a number, like D0 or T1.
+  bool isResource(const std::string& token, char letter) {
+    return (token.length() >= 2 &&
+            std::toupper(token[0]) == letter &&
+            std::isdigit(token[1]));
+  }
+  
+  bool isDelayLine(const std::string& token) {
+    return isResource(token, 'D');
+  }
+  
+  bool isTable(const std::string& token) {
+    return isResource(token, 'T');
+  }
+  
+  bool isDirective(const std::string& token) {
+    return token.length() >= 2 && token[0] == '.';
+  }
+  
+  int parseResourceNumber(const std::string& token, char letter) {
+    if (!isResource(token, letter)) return -1;
+    
+    try {
+      int resourceNum = std::stoi(token.substr(1));
+      if (resourceNum >= 0 && resourceNum < (int)kNumWideIndexes) {
+        return resourceNum;
+      }
+    } catch (...) {
+      return -1;
+    }
+    return -1;
+  }
+  
   int parseRegisterNumber(const std::string& token) {
     if (!isRegister(token)) return -1;
     
     std::string numStr = token.substr(1);
     try {
       int regNum = std::stoi(numStr);
-      if (regNum >= 0 && regNum < (int)kNumRegisters) {
+      if (regNum >= 0 && regNum < (int)kMaxRegisters) {
         return regNum;
       }
     } catch (...) {
@@ -170,52 +209,67 @@ private:
     }
   }
   
-  Operand createRegisterOperand(const std::string& token) {
+  // an operand before encoding. The index may be too big for a narrow instruction,
+  // in which case the instruction will be emitted with a WIDE prefix.
+  struct OperandValue {
+    size_t mode;
+    size_t index;
+  };
+  
+  OperandValue createRegisterOperand(const std::string& token) {
     if (isRegister(token)) {
       int regNum = parseRegisterNumber(token);
       if (regNum >= 0) {
-        return (REGISTER << kOperandIndexBits) | regNum;
+        return {REGISTER, (size_t)regNum};
       }
     } else if (isImmediate(token)) {
       float immediateVal = parseImmediate(token);
       // Encode immediate as 7-bit value (simplified)
       int encodedImm = std::min(127, std::max(0, (int)immediateVal));
-      return (IMMEDIATE << kOperandIndexBits) | encodedImm;
+      return {IMMEDIATE, (size_t)encodedImm};
     }
     
     // Default to register 0 if parsing fails
-    return (REGISTER << kOperandIndexBits) | 0;
+    return {REGISTER, 0};
+  }
+  
+  OperandValue createResourceOperand(const std::string& token) {
+    int resourceNum = parseResourceNumber(token, std::toupper(token[0]));
+    return {REGISTER, (size_t)std::max(0, resourceNum)};
   }
   
-  std::pair<Operand, Operand> createMemoryOperands(const std::string& token, uint16_t literalIndex) {
+  OperandValue createMemoryOperand(const std::string& token, size_t literalIndex) {
     if (isMemoryArena(token)) {
-      auto [baseReg, offsetReg] = parseMemoryArena(token);
+      auto [baseReg, offset] = parseMemoryArena(token);
       if (baseReg >= 0) {
-        // Encode 14-bit arena address across two operands
-        // For now, simple encoding: baseReg in high 7 bits, offsetReg in low 7 bits
-        uint16_t address = (baseReg << 7) | (offsetReg & 0x7F);
-        uint8_t highBits = (address >> 7) & 0x7F;
-        uint8_t lowBits = address & 0x7F;
-        
-        Operand src1 = (ARENA << kOperandIndexBits) | highBits;
-        Operand src2 = (ARENA << kOperandIndexBits) | lowBits;
-        return {src1, src2};
+        // For now, simple encoding: baseReg in high bits, plus offset
+        size_t address = ((size_t)baseReg << kOperandIndexBits) + std::max(0, offset);
+        return {ARENA, address};
       }
     } else if (isLiteral(token)) {
-
-      // Split 14-bit index across two 7-bit operands
-      uint8_t highBits = (literalIndex >> 7) & 0x7F;
-      uint8_t lowBits = literalIndex & 0x7F;
-      
-      Operand src1 = (LITERAL << kOperandIndexBits) | highBits;
-      Operand src2 = (LITERAL << kOperandIndexBits) | lowBits;
-      return {src1, src2};
+      return {LITERAL, literalIndex};
     }
     
     // Default: arena mode, address 0
-    return {(ARENA << kOperandIndexBits) | 0, (ARENA << kOperandIndexBits) | 0};
+    return {ARENA, 0};
   }
   
+  void addRegisterRequirement(Program& program, OperandValue operand) {
+    if (operand.mode == REGISTER) {
+      program.memReqs.registerVectors = std::max(program.memReqs.registerVectors, operand.index + 1);
+    }
+  }
+  
+  void addArenaRequirement(Program& program, OperandValue memory) {
+    if (memory.mode == ARENA) {
+      program.memReqs.stateVectors = std::max(program.memReqs.stateVectors, memory.index + 1);
+    }
+  }
+  
+  void parseDirective(Program& program, const std::vector<std::string>& tokens);
+  void emitInstruction(Program& program, operations op, OperandValue dest, OperandValue src1, OperandValue src2, bool forceWide = false);
+  void emitMemoryInstruction(Program& program, operations op, OperandValue dest, OperandValue memory);
+  
   
 public:
   ToyAssembler() {
@@ -224,6 +278,21 @@ public:
   
   Program assemble(const std::string& assemblyCode) ;
   void printProgram(const Program& program) ;
+  
+  // disassemble a single instruction into assembly text. If the instruction follows a WIDE
+  // prefix, pass the prefix to decode its wide operands.
+  std::string disassemble(const Instruction& instr, const Instruction* prefix = nullptr) ;
+  
+  // print the program annotated with the percentage of time spent in each instruction,
+  // followed by the most used arena locations.
+  void printProfile(const Program& program, const Profile& profile) ;
+  
+  // export the profile in the collapsed stack format read by flame graph tools:
+  // one line per instruction, "mlvm;OP;pc: disassembly ticks".
+  void writeCollapsedStacks(const Program& program, const Profile& profile, std::ostream& out) ;
+  
+  // export the profile as JSON.
+  void writeProfileJSON(const Program& program, const Profile& profile, std::ostream& out) ;
 };
 
 }
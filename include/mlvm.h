@@ -3,6 +3,11 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+
 #include "madronalib.h"
 
 namespace mlvm {
@@ -38,6 +43,12 @@ enum operations {
   SHIFT,
   INTERP,
   SVF,       // dest, src, state
+  WIDE,      // prefix: extends the operand indices of the following instruction
+  DELAY_WRITE,  // delay line, src
+  DELAY_READ,   // dest, delay line, delay time in samples
+  DELAY_TAP,    // dest, delay line, modulated fractional delay times
+  TABLE_LOOKUP, // dest, table, phase: wrapping lookup for wavetable oscillators
+  TABLE_SHAPE,  // dest, table, input: clamped lookup over [-1, 1] for waveshaping
   // ... and many more
   // many opcodes will be much bigger chunks of stateful work like oscillators, table lookups,
   // env followers, and in general DSP machinery.
@@ -105,6 +116,66 @@ struct Instruction {
 
 static_assert(sizeof(Instruction) == 4);
 
+inline size_t getOffset(Operand op1, Operand op2) { return (getIndex(op1) << kOperandIndexBits) | getIndex(op2); }
+
+// WIDE instructions are for programs that need more than 128 registers or more than 2^14 arena
+// or literal locations. A WIDE prefix is followed by the instruction it extends. Each operand byte
+// of the prefix supplies eight high bits for the matching operand index of the next instruction,
+// so wide register indices have 15 bits and wide memory offsets made from src1 and src2 have 30.
+// The operand modes still come from the next instruction. Narrow instructions decode as before;
+// only the WIDE case pays for the extra work.
+
+constexpr size_t kWideIndexBits{kOperandIndexBits + 8};
+constexpr size_t kNumWideIndexes{1 << kWideIndexBits};
+constexpr size_t kMaxRegisters{kNumWideIndexes};
+constexpr size_t kNumNarrowOffsets{1 << (kOperandIndexBits*2)};
+
+inline size_t getWideIndex(Operand high, Operand op) { return (size_t(high) << kOperandIndexBits) | getIndex(op); }
+inline size_t getWideOffset(Instruction prefix, Instruction inst) {
+  return (getWideIndex(prefix.src1, inst.src1) << kWideIndexBits) | getWideIndex(prefix.src2, inst.src2);
+}
+
+// Each operand of an instruction refers to one kind of thing, depending on the operation.
+// setProgram() uses these to check programs, and the assembler to check its input.
+
+enum operandKinds {
+  OPERAND_NONE = 0,
+  OPERAND_REGISTER,   // register or immediate
+  OPERAND_MEMORY,     // arena or literal offset, made from src1 and src2
+  OPERAND_DELAY_LINE,
+  OPERAND_TABLE
+};
+
+struct OperandKinds {
+  operandKinds dest;
+  operandKinds src1;
+  operandKinds src2;
+};
+
+inline OperandKinds getOperandKinds(size_t op) {
+  switch(op) {
+    case NOOP:
+    case END:
+    case WIDE:
+      return {OPERAND_NONE, OPERAND_NONE, OPERAND_NONE};
+    case MOVE:
+      return {OPERAND_REGISTER, OPERAND_REGISTER, OPERAND_NONE};
+    case LOAD:
+    case STORE:
+      return {OPERAND_REGISTER, OPERAND_MEMORY, OPERAND_MEMORY};
+    case DELAY_WRITE:
+      return {OPERAND_DELAY_LINE, OPERAND_REGISTER, OPERAND_NONE};
+    case DELAY_READ:
+    case DELAY_TAP:
+      return {OPERAND_REGISTER, OPERAND_DELAY_LINE, OPERAND_REGISTER};
+    case TABLE_LOOKUP:
+    case TABLE_SHAPE:
+      return {OPERAND_REGISTER, OPERAND_TABLE, OPERAND_REGISTER};
+    default:
+      return {OPERAND_REGISTER, OPERAND_REGISTER, OPERAND_REGISTER};
+  }
+}
+
 // for a few instructions like MUL_ADD, the operands can be restricted to registers, so we
 // can pack four register indices (6 bits * 4) as operands if we want to.
 
@@ -117,20 +188,222 @@ struct MemoryRequirements {
   // storage for the module needing the most scratch, and all modules will share
   // that scratch area.
   size_t scratchVectors;
+  
+  // number of registers a program uses, if more than the kNumRegisters that are always present.
+  size_t registerVectors{0};
+  
+  // number of samples of delay line memory, which is kept apart from the arena vectors.
+  size_t delayFrames{0};
+};
+
+// DELAY LINES are circular buffers in the VM's delay memory. Their lengths are powers of two
+// so that positions can wrap with a mask. All delay lines share one write position, which advances
+// by one vector each time the program runs, so they need no other state.
+// Delay times are measured from the position the current run writes. A program can read a line
+// before or after writing it in the same run:
+// - after DELAY_WRITE, delays from 0 to length - kWidth read the right samples, so a delay of 0
+//   reads the samples just written. The assembler adds kMaxVectorWidth to each length for this.
+// - before DELAY_WRITE, as in a feedback comb or reverb that reads the delayed signal, computes
+//   its output and then writes it, delays from kWidth to length read the right samples.
+// Within these ranges the result doesn't depend on the vector width.
+
+struct DelayLine {
+  // start of the buffer in samples from the beginning of the delay memory.
+  size_t offset;
+  
+  // length of the buffer in samples.
+  size_t length;
 };
 
 struct Program {
   std::vector< Instruction > instructions;
   std::vector< float > literalPool;
+  std::vector< DelayLine > delayLines;
+  
+  // names of the shared tables the program uses, looked up in the TableRegistry by setProgram().
+  std::vector< std::string > tableNames;
   MemoryRequirements memReqs;
 };
 
-struct MLVM {
-  std::vector< DSPVector > registers;
-  std::vector< DSPVector > arena;
+class Table;
+
+// PROFILING accumulates the cost of each instruction of a program, so that we can see
+// which opcodes and which parts of a program are worth optimizing.
+// In the instrumented mode every process() or processBuffers() call is measured. In the sampled
+// mode only one out of every sampleInterval calls is measured, which keeps the overhead low enough
+// to leave on while running a patch in real time.
+
+enum profileModes {
+  PROFILE_OFF = 0,
+  PROFILE_INSTRUMENTED,
+  PROFILE_SAMPLED
+};
+
+struct Profile {
+  // clock ticks spent in, and number of executions of, the instruction at each program counter.
+  std::vector< uint64_t > ticks;
+  std::vector< uint64_t > counts;
+  
+  // number of vector reads and writes at each arena offset.
+  std::vector< uint64_t > arenaReads;
+  std::vector< uint64_t > arenaWrites;
+  
+  // number of vector reads and writes of each delay line.
+  std::vector< uint64_t > delayReads;
+  std::vector< uint64_t > delayWrites;
+  
+  // number of process() or processBuffers() calls that were measured.
+  uint64_t processCalls{0};
+  
+  void clear();
+  uint64_t totalTicks() const;
+};
+
+// VECTORS are the unit of work of the VM. Every register and arena slot holds one vector,
+// and every operation processes one vector of kWidth samples at a time.
+// The width is chosen at compile time: small widths like 16 or 32 give low latency for live use,
+// large widths like 128 or 256 give higher throughput for offline rendering. The default width
+// matches madronalib's DSPVector.
+
+// Vectors are aligned to a cache line, so that auto-vectorized loops can use aligned loads
+// of any SIMD width up to AVX-512.
+
+constexpr size_t kVectorAlignment{64};
+
+// Loops over vectors run over fixed blocks of kVectorBlock floats. Compilers unroll a short loop
+// with a constant count completely, but leave a long one rolled at one SIMD operation per
+// iteration, or copy with a slow string instruction, which made the widths above 64 slower
+// per sample than 64.
+
+constexpr size_t kVectorBlock{16};
+
+template< size_t kWidth >
+struct VMVector {
+  static_assert((kWidth >= 16) && ((kWidth & (kWidth - 1)) == 0), "vector width must be a power of two, at least 16");
+  
+  alignas(kVectorAlignment) float data[kWidth];
+  
+  VMVector() = default;
+  explicit VMVector(float f) { fill(f); }
+  
+  void fill(float f) {
+    for(size_t j=0; j<kWidth; j += kVectorBlock)
+      for(size_t i=j; i<j + kVectorBlock; ++i) data[i] = f;
+  }
+  
+  float& operator[](size_t i) { return data[i]; }
+  float operator[](size_t i) const { return data[i]; }
+};
+
+// Operations write their results to a destination vector, which may also be one of the inputs.
+// Returning vectors by value would copy each result, which is expensive at the larger widths.
+
+template< size_t kWidth >
+inline void copy(const VMVector< kWidth >& a, VMVector< kWidth >& result) {
+  for(size_t j=0; j<kWidth; j += kVectorBlock)
+    for(size_t i=j; i<j + kVectorBlock; ++i) result.data[i] = a.data[i];
+}
+
+template< size_t kWidth >
+inline void add(const VMVector< kWidth >& a, const VMVector< kWidth >& b, VMVector< kWidth >& result) {
+  for(size_t j=0; j<kWidth; j += kVectorBlock)
+    for(size_t i=j; i<j + kVectorBlock; ++i) result.data[i] = a.data[i] + b.data[i];
+}
+
+template< size_t kWidth >
+inline void multiply(const VMVector< kWidth >& a, const VMVector< kWidth >& b, VMVector< kWidth >& result) {
+  for(size_t j=0; j<kWidth; j += kVectorBlock)
+    for(size_t i=j; i<j + kVectorBlock; ++i) result.data[i] = a.data[i] * b.data[i];
+}
+
+// An allocator for arrays of vectors. Storage is aligned by hand, because our Mac builds
+// turn off C++17 aligned new (-fno-aligned-new).
+
+template< class T >
+struct AlignedAllocator {
+  using value_type = T;
+  
+  AlignedAllocator() = default;
+  template< class U > AlignedAllocator(const AlignedAllocator< U >&) {}
+  
+  T* allocate(size_t n) {
+    // allocate extra room to align the block and store the original pointer just before it
+    size_t bytes = n*sizeof(T) + alignof(T) + sizeof(void*);
+    char* pRaw = static_cast< char* >(::operator new(bytes));
+    uintptr_t aligned = (uintptr_t(pRaw) + sizeof(void*) + alignof(T) - 1) & ~uintptr_t(alignof(T) - 1);
+    reinterpret_cast< void** >(aligned)[-1] = pRaw;
+    return reinterpret_cast< T* >(aligned);
+  }
+  
+  void deallocate(T* p, size_t) {
+    ::operator delete(reinterpret_cast< void** >(p)[-1]);
+  }
+  
+  template< class U > bool operator==(const AlignedAllocator< U >&) const { return true; }
+  template< class U > bool operator!=(const AlignedAllocator< U >&) const { return false; }
+};
+
+template< size_t kWidth >
+using VMVectorArray = std::vector< VMVector< kWidth >, AlignedAllocator< VMVector< kWidth > > >;
+
+// the widths for which the VM is compiled into the library.
+constexpr size_t kVectorWidths[]{16, 32, 64, 128, 256};
+
+constexpr size_t getMaxVectorWidth() {
+  size_t maxWidth{0};
+  for(size_t width : kVectorWidths) maxWidth = std::max(maxWidth, width);
+  return maxWidth;
+}
+constexpr size_t kMaxVectorWidth{getMaxVectorWidth()};
+
+// VMInterface lets us choose a vector width at runtime.
+
+struct VMInterface {
+  virtual ~VMInterface() = default;
+  
+  virtual size_t getVectorWidth() const = 0;
+  virtual bool allocateMemory(const MemoryRequirements&) = 0;
+  
+  // set the program to run, growing the register file if the program needs it, and clear the
+  // delay lines and the profile. Returns false, keeping the previous program, if the new program
+  // can't be run safely.
+  virtual bool setProgram(const Program& newCode) = 0;
+  
+  // process one DSPVector of the context's inputs and outputs. If the VM's width is larger than
+  // a DSPVector, the VM buffers its input and output, adding kWidth samples of latency.
+  virtual void process(AudioContext* context) = 0;
+  
+  // process non-interleaved buffers, for offline rendering. frames must be a multiple of the
+  // vector width.
+  virtual void processBuffers(const float* const* inputs, size_t numInputs,
+                              float* const* outputs, size_t numOutputs, size_t frames) = 0;
+  
+  // turn profiling on or off. Any previous profile is cleared.
+  virtual void setProfileMode(profileModes mode, size_t sampleInterval = 64) = 0;
+  virtual const Profile& getProfile() const = 0;
+};
+
+// make a VM with the given vector width, or return null if that width is not compiled in.
+std::unique_ptr< VMInterface > createMLVM(size_t vectorWidth);
+
+template< size_t kWidth = kFloatsPerDSPVector >
+struct MLVM : public VMInterface {
+  using Vector = VMVector< kWidth >;
+  
+  VMVectorArray< kWidth > registers;
+  VMVectorArray< kWidth > arena;
   Program program;
   uint32_t programCounter;
   
+  // the shared tables named by the program. These are never copied.
+  std::vector< std::shared_ptr< const Table > > tables;
+  
+  profileModes profileMode{PROFILE_OFF};
+  size_t profileInterval{1};
+  uint64_t processCounter{0};
+  bool profiling{false};
+  Profile profile;
+  
   //void compile(const JSON& dspGraphInput, Program& programOutput); // TODO - takes JSON list of modules and connections and parameters, makes opcodes and memory needs
   
   // NOTES
@@ -145,16 +418,57 @@ struct MLVM {
   //
   // For crossfades on changes and super-quick undo, we can keep N versions of the program.
 
-  bool allocateMemory(const MemoryRequirements&);
-  void setProgram(const Program& newCode);
-  void process(AudioContext* context);
+  size_t getVectorWidth() const override { return kWidth; }
+  bool allocateMemory(const MemoryRequirements&) override;
+  bool setProgram(const Program& newCode) override;
+  void process(AudioContext* context) override;
+  void processBuffers(const float* const* inputs, size_t numInputs,
+                      float* const* outputs, size_t numOutputs, size_t frames) override;
+  
+  void setProfileMode(profileModes mode, size_t sampleInterval = 64) override;
+  const Profile& getProfile() const override { return profile; }
   
 private:
-  DSPVector getValue(Operand op1);
-  DSPVector getValue2(Operand op1, Operand op2, const std::vector< float >& literals);
-  DSPVector* getDest2(Operand op1, Operand op2);
+  // memory for all delay lines, and the write position common to all of them.
+  std::vector< float > delayMemory;
+  uint64_t delayFrame{0};
+  
+  // buffers for process() when kWidth is larger than a DSPVector.
+  VMVectorArray< kWidth > contextInputs;
+  VMVectorArray< kWidth > contextOutputs;
+  size_t contextFrame{0};
+  
+  // scratch vectors for immediate and literal operands, so that register operands can be
+  // read in place.
+  Vector immediate1;
+  Vector immediate2;
+  
+  void startProcess();
+  void runProgram();
+  template< bool kProfile > void run();
+  void executeWide(Instruction prefix, Instruction inst);
+  
+  void delayWrite(size_t line, const Vector& input);
+  void delayRead(size_t line, float delayTime, Vector& result);
+  void delayTap(size_t line, const Vector& delayTimes, Vector& result);
+  
+  void tableLookup(size_t table, const Vector& phase, Vector& result);
+  void tableShape(size_t table, const Vector& input, Vector& result);
+  void recordInstruction(uint32_t pc, Instruction inst, uint64_t startTicks);
+  void resizeProfile();
+  
+  const Vector& getValue(Operand op, Vector& immediate);
+  const Vector& getWideValue(Operand high, Operand op, Vector& immediate);
+  const Vector& getValue2(Operand op1, Operand op2, const std::vector< float >& literals);
+  Vector* getDest2(Operand op1, Operand op2);
 
 };
 
+extern template struct MLVM< 16 >;
+extern template struct MLVM< 32 >;
+extern template struct MLVM< 64 >;
+extern template struct MLVM< 128 >;
+extern template struct MLVM< 256 >;
+
 } // namespace ml
 
@@ -0,0 +1,67 @@
+// mlvm
+// Copyright (c) 2025 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mlvm {
+
+// TABLES are read-only arrays of floats used by the table opcodes for wavetable oscillators,
+// waveshaping and function approximation. A table is registered once by name and is then shared
+// by every MLVM instance, instead of being copied into each instance's arena or literal pool.
+// A table can also be made by memory-mapping a file of raw 32-bit floats. The mapping is
+// read-only, so every process that maps the same file shares one copy in memory.
+
+class Table {
+public:
+  // make a table that owns a copy of the data.
+  explicit Table(std::vector< float > data);
+  
+  // map a file of native-endian 32-bit floats. Returns null if the file can't be mapped.
+  static std::shared_ptr< const Table > mapFile(const std::string& path);
+  
+  ~Table();
+  
+  Table(const Table&) = delete;
+  Table& operator=(const Table&) = delete;
+  
+  const float* data() const { return pData; }
+  size_t size() const { return numFloats; }
+  
+private:
+  Table() = default;
+  
+  std::vector< float > ownedData;
+  const float* pData{nullptr};
+  size_t numFloats{0};
+  
+  // platform mapping information, if the table is a mapped file.
+  void* mapping{nullptr};
+  size_t mappedBytes{0};
+};
+
+// The TableRegistry holds all the tables in the process. Registering or removing a table
+// doesn't affect programs already using it: they keep a reference until their program changes.
+
+class TableRegistry {
+public:
+  static TableRegistry& instance();
+  
+  std::shared_ptr< const Table > registerTable(const std::string& name, std::vector< float > data);
+  std::shared_ptr< const Table > mapTableFile(const std::string& name, const std::string& path);
+  std::shared_ptr< const Table > getTable(const std::string& name) const;
+  void removeTable(const std::string& name);
+  
+private:
+  TableRegistry() = default;
+  
+  mutable std::mutex tablesMutex;
+  std::unordered_map< std::string, std::shared_ptr< const Table > > tables;
+};
+
+} // namespace mlvm
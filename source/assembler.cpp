@@ -7,8 +7,68 @@
 
 #include "assembler.h"
 
+#include <iomanip>
+
 namespace mlvm {
 
+namespace {
+
+const char* getOperationName(size_t op) {
+  switch(op) {
+    case NOOP: return "NOOP";
+    case END: return "END";
+    case MOVE: return "MOV";
+    case MOVE1: return "MOVE1";
+    case LOAD: return "LDR";
+    case LOAD1: return "LOAD1";
+    case STORE: return "STR";
+    case CMP: return "CMP";
+    case BNE: return "BNE";
+    case JMP: return "JMP";
+    case ADD: return "ADD";
+    case TEST1: return "TEST1";
+    case TEST2: return "TEST2";
+    case MUL: return "MUL";
+    case SHIFT: return "SHIFT";
+    case INTERP: return "INTERP";
+    case SVF: return "SVF";
+    case WIDE: return "WIDE";
+    case DELAY_WRITE: return "DWRITE";
+    case DELAY_READ: return "DREAD";
+    case DELAY_TAP: return "DTAP";
+    case TABLE_LOOKUP: return "TLOOKUP";
+    case TABLE_SHAPE: return "TSHAPE";
+    default: return "???";
+  }
+}
+
+std::string registerOperandText(Operand high, Operand op) {
+  if (getOperandMode(op) == IMMEDIATE) {
+    return "#" + std::to_string(getWideIndex(high, op));
+  }
+  return "R" + std::to_string(getWideIndex(high, op));
+}
+
+// if the instruction at pc is a WIDE prefix, return it and advance pc to the instruction it extends.
+const Instruction* getPrefix(const Program& program, size_t& pc) {
+  if (getOperation(program.instructions[pc].opcode) == WIDE && pc + 1 < program.instructions.size()) {
+    return &program.instructions[pc++];
+  }
+  return nullptr;
+}
+
+// escape a string for use in a JSON string value.
+std::string jsonEscape(const std::string& str) {
+  std::string result;
+  for (char c : str) {
+    if (c == '"' || c == '\\') result += '\\';
+    result += c;
+  }
+  return result;
+}
+
+}
+
 
 Program ToyAssembler::assemble(const std::string& assemblyCode) {
   Program program;
@@ -28,6 +88,11 @@ Program ToyAssembler::assemble(const std::string& assemblyCode) {
     std::vector<std::string> tokens = tokenize(line);
     if (tokens.empty()) continue;
     
+    if (isDirective(tokens[0])) {
+      parseDirective(program, tokens);
+      continue;
+    }
+    
     // Parse instruction
     std::string opName = tokens[0];
     std::transform(opName.begin(), opName.end(), opName.begin(), ::toupper);
@@ -37,81 +102,180 @@ Program ToyAssembler::assemble(const std::string& assemblyCode) {
       continue;
     }
     
-    Instruction instr = {};
-    instr.opcode = opMap[opName]; // MODE_0 by default
-    
     // Parse operands based on instruction type
     operations op = opMap[opName];
     
     if (op == LOAD || op == STORE) {
       // LOAD/STORE: dest is register, src is memory (uses src1+src2)
+      OperandValue dest{REGISTER, 0};
+      OperandValue memory{ARENA, 0};
       if (tokens.size() >= 2) {
-        instr.dest = createRegisterOperand(tokens[1]);
+        dest = createRegisterOperand(tokens[1]);
+        addRegisterRequirement(program, dest);
       }
       if (tokens.size() >= 3) {
-        uint16_t literalIndex{0};
+        size_t literalIndex{0};
         if(isLiteral(tokens[2]))
         {
           // Add float to literal pool and get index
           program.literalPool.push_back(parseLiteral(tokens[2]));
           literalIndex = program.literalPool.size() - 1;
-          literalIndex &= 0xCFFF; // toy impl, wrap
         }
-        auto [src1, src2] = createMemoryOperands(tokens[2], literalIndex);
-        instr.src1 = src1;
-        instr.src2 = src2;
+        memory = createMemoryOperand(tokens[2], literalIndex);
       }
+      emitMemoryInstruction(program, op, dest, memory);
     } else {
-      // Other instructions use register/immediate operands
-      if (tokens.size() >= 2) {
-        instr.dest = createRegisterOperand(tokens[1]);
-      }
-      if (tokens.size() >= 3) {
-        instr.src1 = createRegisterOperand(tokens[2]);
+      // Other instructions use register/immediate operands, or delay lines and tables
+      // where the operation expects them.
+      OperandKinds kinds = getOperandKinds(op);
+      const operandKinds slotKinds[3]{kinds.dest, kinds.src1, kinds.src2};
+      OperandValue operands[3]{{REGISTER, 0}, {REGISTER, 0}, {REGISTER, 0}};
+      bool valid{true};
+      for (size_t i = 0; i < 3 && i + 1 < tokens.size(); ++i) {
+        const std::string& token = tokens[i + 1];
+        switch (slotKinds[i]) {
+          case OPERAND_DELAY_LINE:
+            if (!isDelayLine(token)) {
+              std::cerr << opName << " expects a delay line, not " << token << std::endl;
+              valid = false;
+            }
+            operands[i] = createResourceOperand(token);
+            break;
+          case OPERAND_TABLE:
+            if (!isTable(token)) {
+              std::cerr << opName << " expects a table, not " << token << std::endl;
+              valid = false;
+            }
+            operands[i] = createResourceOperand(token);
+            break;
+          default:
+            if (isDelayLine(token) || isTable(token)) {
+              std::cerr << opName << " expects a register, not " << token << std::endl;
+              valid = false;
+            }
+            operands[i] = createRegisterOperand(token);
+            addRegisterRequirement(program, operands[i]);
+            break;
+        }
       }
-      if (tokens.size() >= 4) {
-        instr.src2 = createRegisterOperand(tokens[3]);
+      if (!valid) continue;
+      
+      // delay lines and tables must be declared before they are used
+      for (size_t i = 0; i < 3; ++i) {
+        if (slotKinds[i] == OPERAND_DELAY_LINE && operands[i].index >= program.delayLines.size()) {
+          std::cerr << "Undeclared delay line: D" << operands[i].index << std::endl;
+          valid = false;
+        } else if (slotKinds[i] == OPERAND_TABLE && operands[i].index >= program.tableNames.size()) {
+          std::cerr << "Undeclared table: T" << operands[i].index << std::endl;
+          valid = false;
+        }
       }
+      if (!valid) continue;
+      
+      emitInstruction(program, op, operands[0], operands[1], operands[2]);
     }
-    
-    program.instructions.push_back(instr);
   }
   
   return program;
 }
   
+// Directives declare resources used by the program.
+// .DELAY Dn, frames: declare delay line n, able to delay by at least the given number of samples.
+// .TABLE Tn, name: use the shared table registered under the given name as table n.
+void ToyAssembler::parseDirective(Program& program, const std::vector<std::string>& tokens) {
+  std::string name = tokens[0];
+  std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+  
+  if (name == ".DELAY") {
+    int lineNum = tokens.size() >= 3 ? parseResourceNumber(tokens[1], 'D') : -1;
+    if (lineNum < 0) {
+      std::cerr << "Bad delay line declaration" << std::endl;
+      return;
+    }
+    if ((size_t)lineNum != program.delayLines.size()) {
+      std::cerr << "Delay lines must be declared once each, in order from D0: " << tokens[1] << std::endl;
+      return;
+    }
+    
+    // A read after the line is written can delay by up to the length minus the vector width,
+    // so add the largest vector width to the requested time, then round up to a power of two.
+    size_t frames = (size_t)std::max(0.f, parseLiteral(tokens[2]));
+    size_t length = kMaxVectorWidth;
+    while (length < frames + kMaxVectorWidth + 1) {
+      length <<= 1;
+    }
+    
+    program.delayLines.push_back(DelayLine{program.memReqs.delayFrames, length});
+    program.memReqs.delayFrames += length;
+  } else if (name == ".TABLE") {
+    int tableNum = tokens.size() >= 3 ? parseResourceNumber(tokens[1], 'T') : -1;
+    if (tableNum < 0) {
+      std::cerr << "Bad table declaration" << std::endl;
+      return;
+    }
+    if ((size_t)tableNum != program.tableNames.size()) {
+      std::cerr << "Tables must be declared once each, in order from T0: " << tokens[1] << std::endl;
+      return;
+    }
+    
+    program.tableNames.push_back(tokens[2]);
+  } else {
+    std::cerr << "Unknown directive: " << name << std::endl;
+  }
+}
+
+// Add an instruction to the program, preceded by a WIDE prefix if any of its
+// operand indices don't fit in a narrow instruction.
+void ToyAssembler::emitInstruction(Program& program, operations op, OperandValue dest, OperandValue src1, OperandValue src2, bool forceWide) {
+  bool wide = forceWide ||
+    (dest.index >= kNumOperandIndexes) ||
+    (src1.index >= kNumOperandIndexes) ||
+    (src2.index >= kNumOperandIndexes);
+  
+  if (wide) {
+    Instruction prefix = {};
+    prefix.opcode = WIDE;
+    prefix.dest = (Operand)(dest.index >> kOperandIndexBits);
+    prefix.src1 = (Operand)(src1.index >> kOperandIndexBits);
+    prefix.src2 = (Operand)(src2.index >> kOperandIndexBits);
+    program.instructions.push_back(prefix);
+  }
+  
+  Instruction instr = {};
+  instr.opcode = op; // MODE_0 by default
+  instr.dest = (Operand)((dest.mode << kOperandIndexBits) | (dest.index & kOperandIndexMask));
+  instr.src1 = (Operand)((src1.mode << kOperandIndexBits) | (src1.index & kOperandIndexMask));
+  instr.src2 = (Operand)((src2.mode << kOperandIndexBits) | (src2.index & kOperandIndexMask));
+  program.instructions.push_back(instr);
+}
+
+// Add a memory instruction, splitting the arena or literal offset across src1 and src2.
+// Offsets of 2^14 and above need a WIDE prefix.
+void ToyAssembler::emitMemoryInstruction(Program& program, operations op, OperandValue dest, OperandValue memory) {
+  if (memory.index >= (size_t(1) << (kWideIndexBits*2))) {
+    std::cerr << "Memory offset out of range: " << memory.index << std::endl;
+    memory.index = 0;
+  }
+  addArenaRequirement(program, memory);
+  
+  bool wide = (dest.index >= kNumOperandIndexes) || (memory.index >= kNumNarrowOffsets);
+  size_t lowBits = wide ? kWideIndexBits : kOperandIndexBits;
+  
+  OperandValue src1{memory.mode, memory.index >> lowBits};
+  OperandValue src2{memory.mode, memory.index & ((size_t(1) << lowBits) - 1)};
+  emitInstruction(program, op, dest, src1, src2, wide);
+}
+
 void ToyAssembler::printProgram(const Program& program) {
   std::cout << "Program with " << program.instructions.size() << " instructions:\n";
   
   for (size_t i = 0; i < program.instructions.size(); ++i) {
-    const auto& instr = program.instructions[i];
-    operations op = (operations)getOperation(instr.opcode);
-    
-    std::cout << i << ": ";
-    std::cout << "Op=" << op << " ";
-    
-    if (op == LOAD || op == STORE) {
-      // For LOAD/STORE, combine src1+src2 to show memory address
-      uint16_t memAddr = ((getIndex(instr.src1) << 7) | getIndex(instr.src2));
-      bool isLiteral = (getOperandMode(instr.src1) == LITERAL);
-      std::cout << "Dest=R" << getIndex(instr.dest) << " ";
-      std::cout << "MemAddr=" << memAddr << "(" << (isLiteral ? "LITERAL" : "ARENA") << ")";
-    } else {
-      std::cout << "Dest=R" << getIndex(instr.dest) << " ";
-      std::cout << "Src1=";
-      if (getOperandMode(instr.src1) == IMMEDIATE) {
-        std::cout << "#" << getIndex(instr.src1);
-      } else {
-        std::cout << "R" << getIndex(instr.src1);
-      }
-      std::cout << " Src2=";
-      if (getOperandMode(instr.src2) == IMMEDIATE) {
-        std::cout << "#" << getIndex(instr.src2);
-      } else {
-        std::cout << "R" << getIndex(instr.src2);
-      }
+    size_t pc = i;
+    const Instruction* prefix = getPrefix(program, i);
+    if (prefix) {
+      std::cout << pc << ": " << disassemble(*prefix) << "\n";
     }
-    std::cout << "\n";
+    std::cout << i << ": " << disassemble(program.instructions[i], prefix) << "\n";
   }
   
   if (!program.literalPool.empty()) {
@@ -122,5 +286,167 @@ void ToyAssembler::printProgram(const Program& program) {
   }
 }
 
+std::string ToyAssembler::disassemble(const Instruction& instr, const Instruction* prefix) {
+  // narrow instructions decode as wide ones with zero high bits
+  const Instruction high = prefix ? *prefix : Instruction{};
+  size_t op = getOperation(instr.opcode);
+  std::string result = getOperationName(op);
+  std::string dest = " R" + std::to_string(getWideIndex(high.dest, instr.dest));
+  
+  switch (op) {
+    case NOOP:
+    case END:
+      break;
+    case WIDE:
+      result += " " + std::to_string(instr.dest) + ", " + std::to_string(instr.src1) +
+        ", " + std::to_string(instr.src2);
+      break;
+    case LOAD:
+    case STORE: {
+      size_t memAddr = prefix ? getWideOffset(high, instr) : getOffset(instr.src1, instr.src2);
+      result += dest + ", ";
+      if (getOperandMode(instr.src1) == LITERAL) {
+        result += "=lit" + std::to_string(memAddr);
+      } else {
+        result += "[#" + std::to_string(memAddr) + "]";
+      }
+      break;
+    }
+    case MOVE:
+      result += dest + ", " + registerOperandText(high.src1, instr.src1);
+      break;
+    case DELAY_WRITE:
+      result += " D" + std::to_string(getWideIndex(high.dest, instr.dest)) + ", " +
+        registerOperandText(high.src1, instr.src1);
+      break;
+    case DELAY_READ:
+    case DELAY_TAP:
+      result += dest + ", D" + std::to_string(getWideIndex(high.src1, instr.src1)) + ", " +
+        registerOperandText(high.src2, instr.src2);
+      break;
+    case TABLE_LOOKUP:
+    case TABLE_SHAPE:
+      result += dest + ", T" + std::to_string(getWideIndex(high.src1, instr.src1)) + ", " +
+        registerOperandText(high.src2, instr.src2);
+      break;
+    default:
+      result += dest + ", " + registerOperandText(high.src1, instr.src1) +
+        ", " + registerOperandText(high.src2, instr.src2);
+      break;
+  }
+  return result;
+}
+
+void ToyAssembler::printProfile(const Program& program, const Profile& profile) {
+  uint64_t totalTicks = profile.totalTicks();
+  double scale = totalTicks > 0 ? 100.0 / totalTicks : 0.0;
+  
+  std::ios oldState(nullptr);
+  oldState.copyfmt(std::cout);
+  
+  std::cout << "Profile of " << profile.processCalls << " process calls, " << totalTicks << " ticks:\n";
+  std::cout << "     %      count    ticks/exec  instruction\n";
+  
+  size_t n = std::min(program.instructions.size(), profile.ticks.size());
+  for (size_t i = 0; i < n; ++i) {
+    // costs of wide instructions are recorded at the prefix
+    size_t pc = i;
+    const Instruction* prefix = getPrefix(program, i);
+    uint64_t count = profile.counts[pc];
+    double perExec = count > 0 ? double(profile.ticks[pc]) / count : 0.0;
+    std::cout << std::fixed << std::setprecision(2) << std::setw(6) << profile.ticks[pc] * scale << "  ";
+    std::cout << std::setw(9) << count << "  ";
+    std::cout << std::setprecision(1) << std::setw(12) << perExec << "  ";
+    std::cout << pc << ": " << disassemble(program.instructions[i], prefix) << "\n";
+  }
+  std::cout.copyfmt(oldState);
+  
+  // list the arena offsets that were accessed, most used first
+  std::vector< size_t > offsets;
+  for (size_t i = 0; i < profile.arenaReads.size(); ++i) {
+    if (profile.arenaReads[i] + profile.arenaWrites[i] > 0) {
+      offsets.push_back(i);
+    }
+  }
+  std::sort(offsets.begin(), offsets.end(), [&](size_t a, size_t b) {
+    return profile.arenaReads[a] + profile.arenaWrites[a] > profile.arenaReads[b] + profile.arenaWrites[b];
+  });
+  
+  if (!offsets.empty()) {
+    std::cout << "\nArena accesses:\n";
+    for (auto offset : offsets) {
+      std::cout << "[#" << offset << "] reads: " << profile.arenaReads[offset];
+      std::cout << " writes: " << profile.arenaWrites[offset] << "\n";
+    }
+  }
+  
+  if (!profile.delayReads.empty()) {
+    std::cout << "\nDelay line accesses:\n";
+    for (size_t i = 0; i < profile.delayReads.size(); ++i) {
+      std::cout << "D" << i << " reads: " << profile.delayReads[i];
+      std::cout << " writes: " << profile.delayWrites[i] << "\n";
+    }
+  }
+}
+
+void ToyAssembler::writeCollapsedStacks(const Program& program, const Profile& profile, std::ostream& out) {
+  size_t n = std::min(program.instructions.size(), profile.ticks.size());
+  for (size_t i = 0; i < n; ++i) {
+    size_t pc = i;
+    const Instruction* prefix = getPrefix(program, i);
+    if (profile.ticks[pc] == 0) continue;
+    const auto& instr = program.instructions[i];
+    out << "mlvm;" << getOperationName(getOperation(instr.opcode)) << ";";
+    out << pc << ": " << disassemble(instr, prefix) << " " << profile.ticks[pc] << "\n";
+  }
+}
+
+void ToyAssembler::writeProfileJSON(const Program& program, const Profile& profile, std::ostream& out) {
+  uint64_t totalTicks = profile.totalTicks();
+  std::ios oldState(nullptr);
+  oldState.copyfmt(out);
+  out << std::fixed << std::setprecision(3);
+  
+  out << "{\n";
+  out << "  \"processCalls\": " << profile.processCalls << ",\n";
+  out << "  \"totalTicks\": " << totalTicks << ",\n";
+  out << "  \"instructions\": [";
+  size_t n = std::min(program.instructions.size(), profile.ticks.size());
+  for (size_t i = 0; i < n; ++i) {
+    size_t pc = i;
+    const Instruction* prefix = getPrefix(program, i);
+    const auto& instr = program.instructions[i];
+    double percent = totalTicks > 0 ? 100.0 * profile.ticks[pc] / totalTicks : 0.0;
+    out << (pc > 0 ? "," : "") << "\n    {";
+    out << "\"pc\": " << pc << ", ";
+    out << "\"op\": \"" << getOperationName(getOperation(instr.opcode)) << "\", ";
+    out << "\"text\": \"" << jsonEscape(disassemble(instr, prefix)) << "\", ";
+    out << "\"count\": " << profile.counts[pc] << ", ";
+    out << "\"ticks\": " << profile.ticks[pc] << ", ";
+    out << "\"percent\": " << percent << "}";
+  }
+  out << "\n  ],\n";
+  out << "  \"arena\": [";
+  bool first{true};
+  for (size_t i = 0; i < profile.arenaReads.size(); ++i) {
+    if (profile.arenaReads[i] + profile.arenaWrites[i] == 0) continue;
+    out << (first ? "" : ",") << "\n    {";
+    out << "\"offset\": " << i << ", ";
+    out << "\"reads\": " << profile.arenaReads[i] << ", ";
+    out << "\"writes\": " << profile.arenaWrites[i] << "}";
+    first = false;
+  }
+  out << "\n  ],\n";
+  out << "  \"delayLines\": [";
+  for (size_t i = 0; i < profile.delayReads.size(); ++i) {
+    out << (i > 0 ? "," : "") << "\n    {";
+    out << "\"line\": " << i << ", ";
+    out << "\"reads\": " << profile.delayReads[i] << ", ";
+    out << "\"writes\": " << profile.delayWrites[i] << "}";
+  }
+  out << "\n  ]\n";
+  out << "}\n";
+  out.copyfmt(oldState);
+}
 
 }
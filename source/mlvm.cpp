@@ -2,62 +2,238 @@
 // Copyright (c) 2025 Madrona Labs LLC. http://www.madronalabs.com
 
 #include "mlvm.h"
+#include "tables.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 
 namespace mlvm {
 
-bool MLVM::allocateMemory(const MemoryRequirements& memReqs) {
+namespace {
+
+inline uint64_t getTicks() {
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+// the number of registers an operand needs, if it is a register.
+inline size_t getRegistersNeeded(operandKinds kind, size_t index, Operand op) {
+  return ((kind == OPERAND_REGISTER) && (getOperandMode(op) == REGISTER)) ? index + 1 : 0;
+}
+
+// the arena or literal pool offset of a load or store, which may follow a WIDE prefix.
+inline size_t getMemoryOffset(const Instruction* prefix, Instruction inst) {
+  return prefix ? getWideOffset(*prefix, inst) : getOffset(inst.src1, inst.src2);
+}
+
+// the number of arena vectors the program's loads and stores reach.
+inline size_t getArenaVectorsNeeded(const Program& program) {
+  size_t vectors{0};
+  const auto& code = program.instructions;
+  for(size_t pc=0; pc<code.size(); ++pc)
+  {
+    const Instruction* prefix{nullptr};
+    if((getOperation(code[pc].opcode) == WIDE) && (pc + 1 < code.size()))
+    {
+      prefix = &code[pc++];
+    }
+    const Instruction& inst = code[pc];
+    auto op = getOperation(inst.opcode);
+    if(((op == LOAD) || (op == STORE)) && (getOperandMode(inst.src1) == ARENA))
+    {
+      vectors = std::max(vectors, getMemoryOffset(prefix, inst) + 1);
+    }
+  }
+  return vectors;
+}
+
+// the number of samples of delay memory the program's delay lines need.
+inline size_t getDelayFramesNeeded(const Program& program) {
+  size_t frames{0};
+  for(const auto& d : program.delayLines)
+  {
+    frames = std::max(frames, d.offset + d.length);
+  }
+  return frames;
+}
+
+}
+
+void Profile::clear() {
+  std::fill(ticks.begin(), ticks.end(), 0);
+  std::fill(counts.begin(), counts.end(), 0);
+  std::fill(arenaReads.begin(), arenaReads.end(), 0);
+  std::fill(arenaWrites.begin(), arenaWrites.end(), 0);
+  std::fill(delayReads.begin(), delayReads.end(), 0);
+  std::fill(delayWrites.begin(), delayWrites.end(), 0);
+  processCalls = 0;
+}
+
+uint64_t Profile::totalTicks() const {
+  uint64_t sum{0};
+  for(auto t : ticks) sum += t;
+  return sum;
+}
+
+template< size_t kWidth >
+bool MLVM< kWidth >::allocateMemory(const MemoryRequirements& memReqs) {
   // TODO errors
-  registers.resize(kNumRegisters);
+  // never shrink the registers, which the current program may need
+  size_t registersNeeded = std::min(std::max(kNumRegisters, memReqs.registerVectors), kMaxRegisters);
+  registers.resize(std::max(registers.size(), registersNeeded));
   
   // TODO errors
-  arena.resize(memReqs.stateVectors + memReqs.scratchVectors);
+  // never make the arena too small for the current program's loads and stores
+  arena.resize(std::max(memReqs.stateVectors + memReqs.scratchVectors, getArenaVectorsNeeded(program)));
+  delayMemory.assign(std::max(memReqs.delayFrames, getDelayFramesNeeded(program)), 0.f);
+  delayFrame = 0;
+  resizeProfile();
   return true;
 }
 
-void MLVM::setProgram(const Program& newCode) {
+template< size_t kWidth >
+bool MLVM< kWidth >::setProgram(const Program& newCode) {
+  // find the registers used, including the wide register indices
+  size_t registersNeeded = newCode.memReqs.registerVectors;
+  const auto& code = newCode.instructions;
+  for(size_t pc=0; pc<code.size(); ++pc)
+  {
+    Instruction high{};
+    const Instruction* prefix{nullptr};
+    if(getOperation(code[pc].opcode) == WIDE)
+    {
+      // a prefix must be followed by the instruction it extends
+      if(pc + 1 >= code.size()) return false;
+      prefix = &code[pc];
+      high = code[pc++];
+    }
+    const Instruction& inst = code[pc];
+    auto op = getOperation(inst.opcode);
+    OperandKinds kinds = getOperandKinds(op);
+    
+    // literals must be in the pool, and can't be stored to. Arena offsets are checked below.
+    if(((op == LOAD) || (op == STORE)) && (getOperandMode(inst.src1) == LITERAL))
+    {
+      if((op == STORE) || (getMemoryOffset(prefix, inst) >= newCode.literalPool.size())) return false;
+    }
+    
+    // delay lines and tables must exist
+    if(((kinds.dest == OPERAND_DELAY_LINE) && (getWideIndex(high.dest, inst.dest) >= newCode.delayLines.size())) ||
+       ((kinds.src1 == OPERAND_DELAY_LINE) && (getWideIndex(high.src1, inst.src1) >= newCode.delayLines.size())) ||
+       ((kinds.src1 == OPERAND_TABLE) && (getWideIndex(high.src1, inst.src1) >= newCode.tableNames.size())))
+    {
+      return false;
+    }
+    
+    registersNeeded = std::max({registersNeeded,
+      getRegistersNeeded(kinds.dest, getWideIndex(high.dest, inst.dest), inst.dest),
+      getRegistersNeeded(kinds.src1, getWideIndex(high.src1, inst.src1), inst.src1),
+      getRegistersNeeded(kinds.src2, getWideIndex(high.src2, inst.src2), inst.src2)});
+  }
+  if(registersNeeded > kMaxRegisters) return false;
+  
+  // loads and stores must stay inside the arena set by allocateMemory()
+  if(getArenaVectorsNeeded(newCode) > arena.size()) return false;
+  
+  // delay line lengths must be powers of two that hold at least one vector
+  for(const auto& d : newCode.delayLines)
+  {
+    if((d.length < kWidth) || (d.length & (d.length - 1)) || (d.offset + d.length < d.offset)) return false;
+  }
+  
+  // the program's tables must all be registered
+  std::vector< std::shared_ptr< const Table > > newTables;
+  for(const auto& name : newCode.tableNames)
+  {
+    auto table = TableRegistry::instance().getTable(name);
+    if(!table) return false;
+    newTables.push_back(std::move(table));
+  }
+  
   program = newCode;
+  tables = std::move(newTables);
+  if(registers.size() < registersNeeded)
+  {
+    registers.resize(registersNeeded);
+  }
+  
+  // start the new program with silent delay lines, rather than replaying what the previous
+  // program left in the delay memory.
+  delayMemory.assign(std::max(delayMemory.size(), getDelayFramesNeeded(program)), 0.f);
+  delayFrame = 0;
+  
+  // the counts for the previous program don't apply to the new one
+  resizeProfile();
+  profile.clear();
+  return true;
 }
 
-// get the value from the operand, handling the register addressing modes.
-DSPVector MLVM::getValue(Operand op)
+template< size_t kWidth >
+void MLVM< kWidth >::setProfileMode(profileModes mode, size_t sampleInterval) {
+  profileMode = mode;
+  profileInterval = (mode == PROFILE_SAMPLED) ? std::max(sampleInterval, size_t(1)) : 1;
+  processCounter = 0;
+  resizeProfile();
+  profile.clear();
+}
+
+template< size_t kWidth >
+void MLVM< kWidth >::resizeProfile() {
+  profile.ticks.resize(program.instructions.size());
+  profile.counts.resize(program.instructions.size());
+  profile.arenaReads.resize(arena.size());
+  profile.arenaWrites.resize(arena.size());
+  profile.delayReads.resize(program.delayLines.size());
+  profile.delayWrites.resize(program.delayLines.size());
+}
+
+// get the value from the operand, handling the register addressing modes. Registers are read
+// in place, and an immediate value is written to the given scratch vector.
+template< size_t kWidth >
+const typename MLVM< kWidth >::Vector& MLVM< kWidth >::getValue(Operand op, Vector& immediate)
 {
-  DSPVector result;
-  switch(getOperandMode(op))
+  if(getOperandMode(op) == REGISTER)
   {
-    case REGISTER:
-      result = registers[getIndex(op)];
-      break;
-    case IMMEDIATE:
-      // fill vector with float immediate
-      result = DSPVector(getImmediate(op));
-      break;
+    return registers[getIndex(op)];
   }
-  return result;
+  // fill vector with float immediate
+  immediate.fill(getImmediate(op));
+  return immediate;
+}
+
+// get the value from the operand extended by the high bits from a WIDE prefix.
+template< size_t kWidth >
+const typename MLVM< kWidth >::Vector& MLVM< kWidth >::getWideValue(Operand high, Operand op, Vector& immediate)
+{
+  size_t index = getWideIndex(high, op);
+  if(getOperandMode(op) == REGISTER)
+  {
+    return registers[index];
+  }
+  immediate.fill(float(index));
+  return immediate;
 }
 
 // get the value from the two operands, handling the memory addressing modes.
-DSPVector MLVM::getValue2(Operand op1, Operand op2, const std::vector< float >& literals)
+template< size_t kWidth >
+const typename MLVM< kWidth >::Vector& MLVM< kWidth >::getValue2(Operand op1, Operand op2, const std::vector< float >& literals)
 {
-  DSPVector result;
-  size_t offset = (getIndex(op1) << 7) | getIndex(op2);
-  switch(getOperandMode(op1))
+  size_t offset = getOffset(op1, op2);
+  if(getOperandMode(op1) == ARENA)
   {
-    case ARENA:
-      result = arena[offset];
-      break;
-    case LITERAL:
-      // fill vector with float literal
-      result = DSPVector(literals[offset]);
-      break;
+    return arena[offset];
   }
-  return result;
+  // fill vector with float literal
+  immediate1.fill(literals[offset]);
+  return immediate1;
 }
 
 // get destination from the two operands, handling the memory addressing modes.
-DSPVector* MLVM::getDest2(Operand op1, Operand op2)
+template< size_t kWidth >
+typename MLVM< kWidth >::Vector* MLVM< kWidth >::getDest2(Operand op1, Operand op2)
 {
-  DSPVector* result{nullptr};
-  size_t offset = (getIndex(op1) << 7) | getIndex(op2);
+  Vector* result{nullptr};
+  size_t offset = getOffset(op1, op2);
   switch(getOperandMode(op1))
   {
     case ARENA:
@@ -71,61 +247,407 @@ DSPVector* MLVM::getDest2(Operand op1, Operand op2)
   return result;
 }
 
-void MLVM::process(AudioContext* context) {
-  size_t destIdx, srcIdx1, srcIdx2;
-  DSPVector v1, v2;
+// execute an instruction following a WIDE prefix. This is kept out of the main loop so
+// that the narrow instructions don't pay for the wider decoding.
+template< size_t kWidth >
+void MLVM< kWidth >::executeWide(Instruction prefix, Instruction inst)
+{
+  size_t destIdx = getWideIndex(prefix.dest, inst.dest);
+  size_t offset = getWideOffset(prefix, inst);
   
-  // main inputs / outputs are dynamic, so check them
-  if (context->outputs.size() < 1) return;
+  switch (inst.opcode) {
+    case MOVE:
+      copy(getWideValue(prefix.src1, inst.src1, immediate1), registers[destIdx]);
+      break;
+    case LOAD:
+      if(getOperandMode(inst.src1) == ARENA)
+      {
+        copy(arena[offset], registers[destIdx]);
+      }
+      else
+      {
+        registers[destIdx].fill(program.literalPool[offset]);
+      }
+      break;
+    case STORE:
+      // in a store, src and dest are reversed
+      copy(getWideValue(prefix.dest, inst.dest, immediate1), arena[offset]);
+      break;
+    case ADD:
+      add(getWideValue(prefix.src1, inst.src1, immediate1), getWideValue(prefix.src2, inst.src2, immediate2), registers[destIdx]);
+      break;
+    case MUL:
+      multiply(getWideValue(prefix.src1, inst.src1, immediate1), getWideValue(prefix.src2, inst.src2, immediate2), registers[destIdx]);
+      break;
+    case DELAY_WRITE:
+      delayWrite(destIdx, getWideValue(prefix.src1, inst.src1, immediate1));
+      break;
+    case DELAY_READ:
+      delayRead(getWideIndex(prefix.src1, inst.src1), getWideValue(prefix.src2, inst.src2, immediate2)[0], registers[destIdx]);
+      break;
+    case DELAY_TAP:
+      delayTap(getWideIndex(prefix.src1, inst.src1), getWideValue(prefix.src2, inst.src2, immediate2), registers[destIdx]);
+      break;
+    case TABLE_LOOKUP:
+      tableLookup(getWideIndex(prefix.src1, inst.src1), getWideValue(prefix.src2, inst.src2, immediate2), registers[destIdx]);
+      break;
+    case TABLE_SHAPE:
+      tableShape(getWideIndex(prefix.src1, inst.src1), getWideValue(prefix.src2, inst.src2, immediate2), registers[destIdx]);
+      break;
+    default:
+      break;
+  }
+}
+
+// write one vector to a delay line at the current write position. Since the length of each
+// delay line is a power of two no smaller than the vector width, the write never wraps.
+template< size_t kWidth >
+void MLVM< kWidth >::delayWrite(size_t line, const Vector& input)
+{
+  const DelayLine& d = program.delayLines[line];
+  float* pBuffer = delayMemory.data() + d.offset;
+  size_t writePos = delayFrame & (d.length - 1);
+  std::copy(input.data, input.data + kWidth, pBuffer + writePos);
+}
+
+// read one vector from a delay line with a fixed delay in samples, clamped to [0, length].
+// The delays that read the right samples depend on the order of the read and the write, as
+// described at DelayLine. A read that doesn't wrap around the end of the buffer is a single
+// block copy.
+template< size_t kWidth >
+void MLVM< kWidth >::delayRead(size_t line, float delayTime, Vector& result)
+{
+  const DelayLine& d = program.delayLines[line];
+  const float* pBuffer = delayMemory.data() + d.offset;
+  const size_t mask = d.length - 1;
+  
+  size_t delayInt = (size_t)std::clamp(delayTime, 0.f, float(d.length));
+  size_t readPos = (delayFrame - delayInt) & mask;
+  
+  if(readPos + kWidth <= d.length)
+  {
+    std::copy(pBuffer + readPos, pBuffer + readPos + kWidth, result.data);
+  }
+  else
+  {
+    size_t firstPart = d.length - readPos;
+    std::copy(pBuffer + readPos, pBuffer + d.length, result.data);
+    std::copy(pBuffer, pBuffer + kWidth - firstPart, result.data + firstPart);
+  }
+}
+
+// read one vector from a delay line with a separate fractional delay time for each sample,
+// using linear interpolation. Delays are clamped to [0, length - 1], and interpolating needs
+// the sample one older than the delay, so each range at DelayLine is one sample shorter. The positions are computed in one pass and the samples are
+// gathered and interpolated in another, so that each loop can be vectorized. Since all the delay
+// times are read before the result is written, the result can be the delay time vector.
+template< size_t kWidth >
+void MLVM< kWidth >::delayTap(size_t line, const Vector& delayTimes, Vector& result)
+{
+  const DelayLine& d = program.delayLines[line];
+  const float* pBuffer = delayMemory.data() + d.offset;
+  const size_t mask = d.length - 1;
+  const float maxDelay = float(d.length - 1);
+  
+  uint32_t pos0[kWidth];
+  uint32_t pos1[kWidth];
+  float frac[kWidth];
+  for(size_t i=0; i<kWidth; ++i)
+  {
+    float delayTime = std::clamp(delayTimes[i], 0.f, maxDelay);
+    uint32_t delayInt = (uint32_t)delayTime;
+    frac[i] = delayTime - delayInt;
+    pos0[i] = (uint32_t)(delayFrame + i - delayInt) & mask;
+    pos1[i] = (pos0[i] - 1) & mask;
+  }
   
-  // copy inputs to registers
-  for(int i=0; i<context->inputs.size(); ++i)
+  for(size_t i=0; i<kWidth; ++i)
   {
-    registers[i] = context->inputs[i];
+    float a = pBuffer[pos0[i]];
+    float b = pBuffer[pos1[i]];
+    result.data[i] = a + frac[i]*(b - a);
   }
+}
 
-  // Here is the innermost loop that interprets the bytecode program.
-  // The program will generate one vector of output.
-  // NOTE: Aside from the main switch, there should be few if any branches.
+// look up a table with a phase, wrapping into [0, 1), using linear interpolation. As with
+// delayTap(), positions are computed in one loop and samples gathered in another.
+template< size_t kWidth >
+void MLVM< kWidth >::tableLookup(size_t tableIdx, const Vector& phase, Vector& result)
+{
+  const Table* pTable = (tableIdx < tables.size()) ? tables[tableIdx].get() : nullptr;
+  if(!pTable)
+  {
+    result.fill(0.f);
+    return;
+  }
+  
+  const float* pData = pTable->data();
+  const uint32_t size = (uint32_t)pTable->size();
+  
+  uint32_t pos0[kWidth];
+  uint32_t pos1[kWidth];
+  float frac[kWidth];
+  for(size_t i=0; i<kWidth; ++i)
+  {
+    float p = phase[i] - std::floor(phase[i]);
+    float x = p*size;
+    uint32_t xInt = std::min((uint32_t)x, size - 1);
+    frac[i] = x - xInt;
+    pos0[i] = xInt;
+    pos1[i] = (xInt + 1 < size) ? xInt + 1 : 0;
+  }
+  
+  for(size_t i=0; i<kWidth; ++i)
+  {
+    float a = pData[pos0[i]];
+    float b = pData[pos1[i]];
+    result.data[i] = a + frac[i]*(b - a);
+  }
+}
+
+// look up a table with an input clamped to [-1, 1], which maps to the first and last entries.
+template< size_t kWidth >
+void MLVM< kWidth >::tableShape(size_t tableIdx, const Vector& input, Vector& result)
+{
+  const Table* pTable = (tableIdx < tables.size()) ? tables[tableIdx].get() : nullptr;
+  if(!pTable)
+  {
+    result.fill(0.f);
+    return;
+  }
+  
+  const float* pData = pTable->data();
+  const uint32_t size = (uint32_t)pTable->size();
+  const float scale = (size - 1)*0.5f;
+  
+  uint32_t pos0[kWidth];
+  uint32_t pos1[kWidth];
+  float frac[kWidth];
+  for(size_t i=0; i<kWidth; ++i)
+  {
+    float x = (std::clamp(input[i], -1.f, 1.f) + 1.f)*scale;
+    uint32_t xInt = std::min((uint32_t)x, size - 1);
+    frac[i] = x - xInt;
+    pos0[i] = xInt;
+    pos1[i] = std::min(xInt + 1, size - 1);
+  }
+  
+  for(size_t i=0; i<kWidth; ++i)
+  {
+    float a = pData[pos0[i]];
+    float b = pData[pos1[i]];
+    result.data[i] = a + frac[i]*(b - a);
+  }
+}
+
+// record the time spent in one instruction and any arena or delay memory it touched.
+template< size_t kWidth >
+void MLVM< kWidth >::recordInstruction(uint32_t pc, Instruction inst, uint64_t startTicks)
+{
+  profile.ticks[pc] += getTicks() - startTicks;
+  profile.counts[pc]++;
+  
+  auto op = getOperation(inst.opcode);
+  Instruction high{};
+  size_t offset{0};
+  if(op == WIDE)
+  {
+    // the accesses are made by the instruction following the prefix
+    high = inst;
+    inst = program.instructions[pc + 1];
+    op = getOperation(inst.opcode);
+    offset = getWideOffset(high, inst);
+  }
+  else
+  {
+    offset = getOffset(inst.src1, inst.src2);
+  }
+  
+  if(op == DELAY_WRITE)
+  {
+    profile.delayWrites[getWideIndex(high.dest, inst.dest)]++;
+  }
+  else if((op == DELAY_READ) || (op == DELAY_TAP))
+  {
+    profile.delayReads[getWideIndex(high.src1, inst.src1)]++;
+  }
+  else if(((op == LOAD) || (op == STORE)) && (getOperandMode(inst.src1) == ARENA))
+  {
+    if(offset < arena.size())
+    {
+      if(op == LOAD)
+      {
+        profile.arenaReads[offset]++;
+      }
+      else
+      {
+        profile.arenaWrites[offset]++;
+      }
+    }
+  }
+}
+
+// Here is the innermost loop that interprets the bytecode program.
+// The program will generate one vector of output.
+// NOTE: Aside from the main switch, there should be few if any branches.
+// When kProfile is false, the profiling code is compiled out entirely.
+
+template< size_t kWidth >
+template< bool kProfile >
+void MLVM< kWidth >::run() {
+  size_t destIdx;
+  uint32_t pc{0};
+  uint64_t startTicks{0};
   
   programCounter = 0;
   while(1) {
+    if constexpr(kProfile) {
+      pc = programCounter;
+      startTicks = getTicks();
+    }
+    
     auto inst = program.instructions[programCounter++];
     destIdx = getIndex(inst.dest);
 
-    v1 = getValue(inst.src1);
-    v2 = getValue(inst.src2);
-
+    // each case reads only the operands it uses. Registers are read in place rather than
+    // copied, which matters at the larger vector widths.
     switch (inst.opcode) {
       case NOOP:
         break;
       case MOVE:
-        registers[destIdx] = v1;
+        copy(getValue(inst.src1, immediate1), registers[destIdx]);
         break;
       case LOAD:
-        registers[destIdx] = getValue2(inst.src1, inst.src2, program.literalPool);
+        copy(getValue2(inst.src1, inst.src2, program.literalPool), registers[destIdx]);
         break;
       case STORE:
         // in a store, src and dest are reversed
-        *(getDest2(inst.src1, inst.src2)) = getValue(inst.dest);
+        copy(getValue(inst.dest, immediate1), *(getDest2(inst.src1, inst.src2)));
         break;
       case ADD:
-        registers[destIdx] = add(v1, v2);
+        add(getValue(inst.src1, immediate1), getValue(inst.src2, immediate2), registers[destIdx]);
         break;
       case MUL:
-        registers[destIdx] = multiply(v1, v2);
+        multiply(getValue(inst.src1, immediate1), getValue(inst.src2, immediate2), registers[destIdx]);
+        break;
+      case WIDE:
+        executeWide(inst, program.instructions[programCounter++]);
+        break;
+      case DELAY_WRITE:
+        delayWrite(destIdx, getValue(inst.src1, immediate1));
+        break;
+      case DELAY_READ:
+        delayRead(getIndex(inst.src1), getValue(inst.src2, immediate2)[0], registers[destIdx]);
+        break;
+      case DELAY_TAP:
+        delayTap(getIndex(inst.src1), getValue(inst.src2, immediate2), registers[destIdx]);
+        break;
+      case TABLE_LOOKUP:
+        tableLookup(getIndex(inst.src1), getValue(inst.src2, immediate2), registers[destIdx]);
+        break;
+      case TABLE_SHAPE:
+        tableShape(getIndex(inst.src1), getValue(inst.src2, immediate2), registers[destIdx]);
         break;
       case END:
-        goto endprogram;
+        if constexpr(kProfile) {
+          recordInstruction(pc, inst, startTicks);
+        }
+        return;
     }
+    
+    if constexpr(kProfile) {
+      recordInstruction(pc, inst, startTicks);
+    }
+  }
+}
+
+// decide whether to measure the current process() or processBuffers() call. A call may
+// run the program any number of times, depending on the vector width and buffer size.
+template< size_t kWidth >
+void MLVM< kWidth >::startProcess() {
+  profiling = (profileMode != PROFILE_OFF) && (processCounter++ % profileInterval == 0);
+  if(profiling)
+  {
+    profile.processCalls++;
   }
+}
 
-  endprogram:
-  
-  // copy registers to outputs
-  for(int i=0; i<context->outputs.size(); ++i)
+// run the program once, measuring it if needed.
+template< size_t kWidth >
+void MLVM< kWidth >::runProgram() {
+  if(profiling)
   {
-    context->outputs[i] = registers[i];
+    run< true >();
+  }
+  else
+  {
+    run< false >();
+  }
+  delayFrame += kWidth;
+}
+
+template< size_t kWidth >
+void MLVM< kWidth >::process(AudioContext* context) {
+  // main inputs / outputs are dynamic, so check them
+  if (context->outputs.size() < 1) return;
+  
+  startProcess();
+  
+  const size_t nInputs = std::min(context->inputs.size(), registers.size());
+  const size_t nOutputs = std::min(context->outputs.size(), registers.size());
+  
+  if constexpr(kWidth <= kFloatsPerDSPVector) {
+    // run the program once for each kWidth-sized slice of the context's vectors.
+    for(size_t start=0; start<kFloatsPerDSPVector; start += kWidth)
+    {
+      // copy inputs to registers
+      for(size_t i=0; i<nInputs; ++i)
+      {
+        const float* pSrc = context->inputs[i].getConstBuffer() + start;
+        std::copy(pSrc, pSrc + kWidth, registers[i].data);
+      }
+
+      runProgram();
+      
+      // copy registers to outputs
+      for(size_t i=0; i<nOutputs; ++i)
+      {
+        std::copy(registers[i].data, registers[i].data + kWidth, context->outputs[i].getBuffer() + start);
+      }
+    }
+  } else {
+    // collect inputs until we have a full vector, running the program once per kWidth samples.
+    // outputs are delayed by one VM vector.
+    contextInputs.resize(nInputs);
+    contextOutputs.resize(nOutputs, Vector(0.f));
+    
+    for(size_t i=0; i<nInputs; ++i)
+    {
+      const float* pSrc = context->inputs[i].getConstBuffer();
+      std::copy(pSrc, pSrc + kFloatsPerDSPVector, contextInputs[i].data + contextFrame);
+    }
+    for(size_t i=0; i<nOutputs; ++i)
+    {
+      const float* pSrc = contextOutputs[i].data + contextFrame;
+      std::copy(pSrc, pSrc + kFloatsPerDSPVector, context->outputs[i].getBuffer());
+    }
+    
+    contextFrame += kFloatsPerDSPVector;
+    if(contextFrame == kWidth)
+    {
+      contextFrame = 0;
+      for(size_t i=0; i<nInputs; ++i)
+      {
+        registers[i] = contextInputs[i];
+      }
+      
+      runProgram();
+      
+      for(size_t i=0; i<nOutputs; ++i)
+      {
+        contextOutputs[i] = registers[i];
+      }
+    }
   }
 
   // TEMP
@@ -142,6 +664,53 @@ void MLVM::process(AudioContext* context) {
   }
 }
 
+template< size_t kWidth >
+void MLVM< kWidth >::processBuffers(const float* const* inputs, size_t numInputs,
+                                    float* const* outputs, size_t numOutputs, size_t frames) {
+  numInputs = std::min(numInputs, registers.size());
+  numOutputs = std::min(numOutputs, registers.size());
+  
+  startProcess();
+  
+  for(size_t start=0; start + kWidth <= frames; start += kWidth)
+  {
+    for(size_t i=0; i<numInputs; ++i)
+    {
+      std::copy(inputs[i] + start, inputs[i] + start + kWidth, registers[i].data);
+    }
+    
+    runProgram();
+    
+    for(size_t i=0; i<numOutputs; ++i)
+    {
+      std::copy(registers[i].data, registers[i].data + kWidth, outputs[i] + start);
+    }
+  }
+}
+
+template struct MLVM< 16 >;
+template struct MLVM< 32 >;
+template struct MLVM< 64 >;
+template struct MLVM< 128 >;
+template struct MLVM< 256 >;
+
+std::unique_ptr< VMInterface > createMLVM(size_t vectorWidth) {
+  switch(vectorWidth) {
+    case 16:
+      return std::make_unique< MLVM< 16 > >();
+    case 32:
+      return std::make_unique< MLVM< 32 > >();
+    case 64:
+      return std::make_unique< MLVM< 64 > >();
+    case 128:
+      return std::make_unique< MLVM< 128 > >();
+    case 256:
+      return std::make_unique< MLVM< 256 > >();
+    default:
+      return nullptr;
+  }
+}
+
 } // namespace ml
 
   
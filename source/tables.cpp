@@ -0,0 +1,108 @@
+// mlvm
+// Copyright (c) 2025 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "tables.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mlvm {
+
+Table::Table(std::vector< float > data) : ownedData(std::move(data)) {
+  pData = ownedData.data();
+  numFloats = ownedData.size();
+}
+
+std::shared_ptr< const Table > Table::mapFile(const std::string& path) {
+  std::shared_ptr< Table > table(new Table());
+  
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return nullptr;
+  
+  LARGE_INTEGER fileSize;
+  HANDLE mappingHandle{nullptr};
+  if (GetFileSizeEx(file, &fileSize) && (fileSize.QuadPart >= (LONGLONG)sizeof(float))) {
+    mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  }
+  CloseHandle(file);
+  if (!mappingHandle) return nullptr;
+  
+  void* view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mappingHandle);
+  if (!view) return nullptr;
+  
+  table->mapping = view;
+  table->mappedBytes = (size_t)fileSize.QuadPart;
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return nullptr;
+  
+  struct stat fileInfo;
+  if ((fstat(fd, &fileInfo) != 0) || (fileInfo.st_size < (off_t)sizeof(float))) {
+    close(fd);
+    return nullptr;
+  }
+  
+  void* view = mmap(nullptr, (size_t)fileInfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED) return nullptr;
+  
+  table->mapping = view;
+  table->mappedBytes = (size_t)fileInfo.st_size;
+#endif
+  
+  table->pData = static_cast< const float* >(table->mapping);
+  table->numFloats = table->mappedBytes / sizeof(float);
+  return table;
+}
+
+Table::~Table() {
+  if (!mapping) return;
+#if defined(_WIN32)
+  UnmapViewOfFile(mapping);
+#else
+  munmap(mapping, mappedBytes);
+#endif
+}
+
+TableRegistry& TableRegistry::instance() {
+  static TableRegistry registry;
+  return registry;
+}
+
+std::shared_ptr< const Table > TableRegistry::registerTable(const std::string& name, std::vector< float > data) {
+  if (data.empty()) return nullptr;
+  auto table = std::make_shared< const Table >(std::move(data));
+  std::lock_guard< std::mutex > lock(tablesMutex);
+  tables[name] = table;
+  return table;
+}
+
+std::shared_ptr< const Table > TableRegistry::mapTableFile(const std::string& name, const std::string& path) {
+  auto table = Table::mapFile(path);
+  if (!table) return nullptr;
+  std::lock_guard< std::mutex > lock(tablesMutex);
+  tables[name] = table;
+  return table;
+}
+
+std::shared_ptr< const Table > TableRegistry::getTable(const std::string& name) const {
+  std::lock_guard< std::mutex > lock(tablesMutex);
+  auto it = tables.find(name);
+  return (it != tables.end()) ? it->second : nullptr;
+}
+
+void TableRegistry::removeTable(const std::string& name) {
+  std::lock_guard< std::mutex > lock(tablesMutex);
+  tables.erase(name);
+}
+
+} // namespace mlvm